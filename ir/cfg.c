@@ -0,0 +1,281 @@
+#include <ir/cfg.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool cfg_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+static RegSet cfg_value_reg(Value* v) {
+  return v->type == REG ? 1U << v->reg : 0;
+}
+
+RegSet inst_uses(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+    case LOAD:
+    case PUTC:
+      return cfg_value_reg(&inst->src);
+
+    case ADD:
+    case SUB:
+    case STORE:
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      return cfg_value_reg(&inst->dst) | cfg_value_reg(&inst->src);
+
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      return (cfg_value_reg(&inst->dst) | cfg_value_reg(&inst->src) |
+              cfg_value_reg(&inst->jmp));
+
+    case JMP:
+      return cfg_value_reg(&inst->jmp);
+
+    default:
+      return 0;
+  }
+}
+
+RegSet inst_defs(Inst* inst) {
+  switch (inst->op) {
+    case MOV:
+    case ADD:
+    case SUB:
+    case LOAD:
+    case GETC:
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      return cfg_value_reg(&inst->dst);
+
+    default:
+      return 0;
+  }
+}
+
+static bool cfg_has_block(CFG* cfg, int pc) {
+  return pc >= 0 && pc < cfg->num_blocks && cfg->blocks[pc].head;
+}
+
+static void cfg_mark_address(CFG* cfg, int pc) {
+  if (cfg_has_block(cfg, pc))
+    cfg->blocks[pc].address_taken = true;
+}
+
+static void cfg_add_succ(CFG* cfg, BasicBlock* bb, int pc, int* cap) {
+  if (!cfg_has_block(cfg, pc))
+    return;
+  for (int i = 0; i < bb->num_succs; i++) {
+    if (bb->succs[i] == pc)
+      return;
+  }
+  if (bb->num_succs == *cap) {
+    int* succs = malloc(sizeof(int) * *cap * 2);
+    memcpy(succs, bb->succs, sizeof(int) * bb->num_succs);
+    free(bb->succs);
+    bb->succs = succs;
+    *cap *= 2;
+  }
+  bb->succs[bb->num_succs++] = pc;
+}
+
+static void cfg_build_edges(CFG* cfg) {
+  for (int pc = 0; pc < cfg->num_blocks; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    if (!bb->head)
+      continue;
+    int cap = 4;
+    bb->succs = malloc(sizeof(int) * cap);
+    bool falls_through = true;
+    Inst* inst = bb->head;
+    for (int i = 0; i < bb->num_insts; i++, inst = inst->next) {
+      if (inst->op == EXIT) {
+        falls_through = false;
+        break;
+      }
+      if (!cfg_is_jump(inst->op))
+        continue;
+      if (inst->jmp.type == IMM) {
+        cfg_add_succ(cfg, bb, inst->jmp.imm, &cap);
+      } else {
+        bb->has_indirect_jump = true;
+        for (int j = 0; j < cfg->num_address_taken; j++)
+          cfg_add_succ(cfg, bb, cfg->address_taken[j], &cap);
+      }
+      if (inst->op == JMP) {
+        falls_through = false;
+        break;
+      }
+    }
+    if (falls_through)
+      cfg_add_succ(cfg, bb, pc + 1, &cap);
+  }
+
+  for (int pc = 0; pc < cfg->num_blocks; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    for (int i = 0; i < bb->num_succs; i++)
+      cfg->blocks[bb->succs[i]].num_preds++;
+  }
+  for (int pc = 0; pc < cfg->num_blocks; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    bb->preds = malloc(sizeof(int) * (bb->num_preds + 1));
+    bb->num_preds = 0;
+  }
+  for (int pc = 0; pc < cfg->num_blocks; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    for (int i = 0; i < bb->num_succs; i++) {
+      BasicBlock* succ = &cfg->blocks[bb->succs[i]];
+      succ->preds[succ->num_preds++] = pc;
+    }
+  }
+}
+
+static void cfg_mark_reachable(CFG* cfg, int entry) {
+  int* stack = malloc(sizeof(int) * (cfg->num_blocks + 1));
+  int sp = 0;
+  for (int i = -1; i < cfg->num_address_taken; i++) {
+    int pc = i < 0 ? entry : cfg->address_taken[i];
+    if (cfg->blocks[pc].reachable)
+      continue;
+    cfg->blocks[pc].reachable = true;
+    stack[sp++] = pc;
+    while (sp) {
+      BasicBlock* bb = &cfg->blocks[stack[--sp]];
+      for (int j = 0; j < bb->num_succs; j++) {
+        BasicBlock* succ = &cfg->blocks[bb->succs[j]];
+        if (!succ->reachable) {
+          succ->reachable = true;
+          stack[sp++] = succ->pc;
+        }
+      }
+    }
+  }
+  free(stack);
+}
+
+static RegSet cfg_transfer(BasicBlock* bb, RegSet live) {
+  Inst** insts = malloc(sizeof(Inst*) * (bb->num_insts + 1));
+  Inst* inst = bb->head;
+  for (int i = 0; i < bb->num_insts; i++, inst = inst->next)
+    insts[i] = inst;
+  for (int i = bb->num_insts - 1; i >= 0; i--)
+    live = (live & ~inst_defs(insts[i])) | inst_uses(insts[i]);
+  free(insts);
+  return live;
+}
+
+// A backward dataflow iteration, which visits blocks in reverse pc
+// order so most of forward edges converge in a single round.
+static void cfg_compute_liveness(CFG* cfg) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int pc = cfg->num_blocks - 1; pc >= 0; pc--) {
+      BasicBlock* bb = &cfg->blocks[pc];
+      if (!bb->head)
+        continue;
+      RegSet out = 0;
+      for (int i = 0; i < bb->num_succs; i++)
+        out |= cfg->blocks[bb->succs[i]].live_in;
+      RegSet in = cfg_transfer(bb, out);
+      if (out != bb->live_out || in != bb->live_in) {
+        bb->live_out = out;
+        bb->live_in = in;
+        changed = true;
+      }
+    }
+  }
+}
+
+void cfg_inst_live_out(BasicBlock* bb, RegSet* live) {
+  Inst** insts = malloc(sizeof(Inst*) * (bb->num_insts + 1));
+  Inst* inst = bb->head;
+  for (int i = 0; i < bb->num_insts; i++, inst = inst->next)
+    insts[i] = inst;
+  RegSet l = bb->live_out;
+  for (int i = bb->num_insts - 1; i >= 0; i--) {
+    live[i] = l;
+    l = (l & ~inst_defs(insts[i])) | inst_uses(insts[i]);
+  }
+  free(insts);
+}
+
+CFG* build_cfg(Module* module) {
+  CFG* cfg = calloc(1, sizeof(CFG));
+  int max_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (max_pc < inst->pc)
+      max_pc = inst->pc;
+  }
+  cfg->num_blocks = max_pc + 1;
+  cfg->blocks = calloc(cfg->num_blocks + 1, sizeof(BasicBlock));
+  for (int pc = 0; pc < cfg->num_blocks; pc++)
+    cfg->blocks[pc].pc = pc;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    BasicBlock* bb = &cfg->blocks[inst->pc];
+    if (!bb->head)
+      bb->head = inst;
+    bb->last = inst;
+    bb->num_insts++;
+  }
+  if (!module->text)
+    return cfg;
+
+  for (Data* data = module->data; data; data = data->next)
+    cfg_mark_address(cfg, data->v);
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (inst->dst.type == IMM)
+      cfg_mark_address(cfg, inst->dst.imm);
+    if (inst->src.type == IMM)
+      cfg_mark_address(cfg, inst->src.imm);
+  }
+  cfg->address_taken = malloc(sizeof(int) * (cfg->num_blocks + 1));
+  for (int pc = 0; pc < cfg->num_blocks; pc++) {
+    if (cfg->blocks[pc].address_taken)
+      cfg->address_taken[cfg->num_address_taken++] = pc;
+  }
+
+  cfg_build_edges(cfg);
+  cfg_mark_reachable(cfg, module->text->pc);
+  cfg_compute_liveness(cfg);
+  return cfg;
+}
+
+void free_cfg(CFG* cfg) {
+  for (int pc = 0; pc < cfg->num_blocks; pc++) {
+    free(cfg->blocks[pc].succs);
+    free(cfg->blocks[pc].preds);
+  }
+  free(cfg->blocks);
+  free(cfg->address_taken);
+  free(cfg);
+}
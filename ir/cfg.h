@@ -0,0 +1,53 @@
+#ifndef ELVM_CFG_H_
+#define ELVM_CFG_H_
+
+#include <stdbool.h>
+
+#include <ir/ir.h>
+
+// A control flow graph of a Module. Each pc is a basic block, so
+// blocks are indexed by pc. A pc without instructions has a block
+// whose head is NULL.
+//
+// Labels are already resolved to integers when a Module is loaded, so
+// any immediate which is not a direct jump destination and any data
+// word is conservatively considered as an address of a basic block.
+// A register-indirect jump may go to any of such address-taken blocks.
+
+// Sets of registers are bit masks with (1 << reg).
+typedef unsigned int RegSet;
+
+typedef struct {
+  int pc;
+  Inst* head;
+  Inst* last;
+  int num_insts;
+  int* succs;
+  int num_succs;
+  int* preds;
+  int num_preds;
+  bool address_taken;
+  bool reachable;
+  bool has_indirect_jump;
+  RegSet live_in;
+  RegSet live_out;
+} BasicBlock;
+
+typedef struct {
+  int num_blocks;
+  BasicBlock* blocks;
+  int num_address_taken;
+  int* address_taken;
+} CFG;
+
+CFG* build_cfg(Module* module);
+void free_cfg(CFG* cfg);
+
+RegSet inst_uses(Inst* inst);
+RegSet inst_defs(Inst* inst);
+
+// Fills |live| with the registers live right after each instruction of
+// |bb|, i.e., live[i] is for the i-th instruction.
+void cfg_inst_live_out(BasicBlock* bb, RegSet* live);
+
+#endif  // ELVM_CFG_H_
@@ -1,4 +1,6 @@
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <ir/ir.h>
 
@@ -8,11 +10,30 @@ int main(int argc, char* argv[]) {
   // Host dump_ir.c.exe should dump to stdout for testing.
   stderr = stdout;
 #else
+  // -q only loads the module, which is useful to measure load time.
+  // -b writes the module in the binary EIR format to stdout.
+  bool quiet = false;
+  bool binary = false;
+  if (argc >= 2 && !strcmp(argv[1], "-q")) {
+    quiet = true;
+    argc--;
+    argv++;
+  } else if (argc >= 2 && !strcmp(argv[1], "-b")) {
+    binary = true;
+    argc--;
+    argv++;
+  }
   if (argc < 2) {
     fprintf(stderr, "no input file\n");
     exit(1);
   }
   Module* m = load_eir_from_file(argv[1]);
+  if (quiet)
+    return 0;
+  if (binary) {
+    dump_eirb(m, stdout);
+    return 0;
+  }
 #endif
   for (Inst* inst = m->text; inst; inst = inst->next) {
     dump_inst(inst);
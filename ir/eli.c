@@ -12,12 +12,73 @@
 #define MEMSZ 0x1000000
 #endif
 
+// Use labels as values to thread handlers directly when the host
+// compiler supports it. Otherwise, we dispatch with a switch.
+#if defined(__GNUC__) && !defined(__eir__)
+#define ELI_DIRECT_THREADED
+#endif
+
+// Operand-specialized handlers for the decoded program. The suffixes
+// are the operand types of dst and src, e.g., ADD_REG_IMM is "add A, 3"
+// and JEQ_REG_REG is "jeq label, A, B". Each group must keep the order
+// of Op so the decoder can compute handlers by offsets.
+#define ELI_OPS(X)                                                \
+  X(MOV_REG_REG) X(MOV_REG_IMM)                                   \
+  X(ADD_REG_REG) X(ADD_REG_IMM)                                   \
+  X(SUB_REG_REG) X(SUB_REG_IMM)                                   \
+  X(LOAD_REG_REG) X(LOAD_REG_IMM)                                 \
+  X(STORE_REG_REG) X(STORE_REG_IMM)                               \
+  X(PUTC_REG) X(PUTC_IMM)                                         \
+  X(GETC_REG)                                                     \
+  X(EXIT)                                                         \
+  X(DUMP)                                                         \
+  X(EQ_REG_REG) X(EQ_REG_IMM) X(NE_REG_REG) X(NE_REG_IMM)         \
+  X(LT_REG_REG) X(LT_REG_IMM) X(GT_REG_REG) X(GT_REG_IMM)         \
+  X(LE_REG_REG) X(LE_REG_IMM) X(GE_REG_REG) X(GE_REG_IMM)         \
+  X(MUL_REG_REG) X(MUL_REG_IMM) X(DIV_REG_REG) X(DIV_REG_IMM)     \
+  X(MOD_REG_REG) X(MOD_REG_IMM) X(AND_REG_REG) X(AND_REG_IMM)     \
+  X(OR_REG_REG) X(OR_REG_IMM) X(XOR_REG_REG) X(XOR_REG_IMM)       \
+  X(SHL_REG_REG) X(SHL_REG_IMM) X(SHR_REG_REG) X(SHR_REG_IMM)     \
+  X(JEQ_REG_REG) X(JEQ_REG_IMM) X(JNE_REG_REG) X(JNE_REG_IMM)     \
+  X(JLT_REG_REG) X(JLT_REG_IMM) X(JGT_REG_REG) X(JGT_REG_IMM)     \
+  X(JLE_REG_REG) X(JLE_REG_IMM) X(JGE_REG_REG) X(JGE_REG_IMM)     \
+  X(JCC_IND)                                                      \
+  X(JMP_IMM) X(JMP_REG)                                           \
+  X(TRACE)                                                        \
+  X(BAD_JUMP)                                                     \
+  X(END)
+
+typedef enum {
+#define ELI_OP_ENUM(name) ELI_##name,
+  ELI_OPS(ELI_OP_ENUM)
+#undef ELI_OP_ENUM
+  ELI_LAST_OP
+} EliOp;
+
+// A decoded instruction. Register operands are stored as register
+// numbers and immediate operands as their values. Jumps to immediate
+// destinations are resolved to the decoded instruction in advance.
+typedef struct Code_ {
+#ifdef ELI_DIRECT_THREADED
+  void* handler;
+#endif
+  int op;
+  int dst;
+  int src;
+  struct Code_* target;
+  Inst* inst;
+} Code;
+
 int pc;
-Inst* prog[65536];
 int mem[MEMSZ];
 int regs[6];
 bool verbose;
 
+static Code* codes;
+static int num_codes;
+static Code** pc2code;
+static int max_pc;
+
 #ifdef __GNUC__
 __attribute__((noreturn))
 #endif
@@ -84,14 +145,262 @@ static int cmp(Inst* inst) {
   }
 }
 
+static Code* add_code(int op, Inst* inst) {
+  Code* c = &codes[num_codes++];
+  c->op = op;
+  c->inst = inst;
+  return c;
+}
+
+static int decode_op(int op, int kinds) {
+  int is_imm = (kinds & FLAT_SRC_IMM) != 0;
+  switch (op) {
+    case MOV:
+    case ADD:
+    case SUB:
+    case LOAD:
+    case STORE:
+      return ELI_MOV_REG_REG + (op - MOV) * 2 + is_imm;
+    case PUTC:
+      return ELI_PUTC_REG + is_imm;
+    case GETC:
+      return ELI_GETC_REG;
+    case EXIT:
+      return ELI_EXIT;
+    case DUMP:
+      return ELI_DUMP;
+    case EQ:
+    case NE:
+    case LT:
+    case GT:
+    case LE:
+    case GE:
+      return ELI_EQ_REG_REG + (op - EQ) * 2 + is_imm;
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+      return ELI_MUL_REG_REG + (op - MUL) * 2 + is_imm;
+    case JEQ:
+    case JNE:
+    case JLT:
+    case JGT:
+    case JLE:
+    case JGE:
+      if (!(kinds & FLAT_JMP_IMM))
+        return ELI_JCC_IND;
+      return ELI_JEQ_REG_REG + (op - JEQ) * 2 + is_imm;
+    case JMP:
+      return kinds & FLAT_JMP_IMM ? ELI_JMP_IMM : ELI_JMP_REG;
+    default:
+      error("oops");
+  }
+}
+
+// Decodes the flat view of the module into an array of specialized
+// handlers so the main loop does no operand type checks.
+static void decode(Module* m, FlatModule* f) {
+  max_pc = f->num_pcs - 1;
+
+  // Each instruction may need a trace handler and a handler which
+  // reports a jump to a missing pc.
+  codes = calloc(f->num_insts * (verbose ? 3 : 2) + 1, sizeof(Code));
+  pc2code = calloc(f->num_pcs, sizeof(Code*));
+  Inst* inst = m->text;
+  for (int i = 0; i < f->num_insts; i++, inst = inst->next) {
+    Code* first = NULL;
+    if (verbose)
+      first = add_code(ELI_TRACE, inst);
+    Code* c = add_code(decode_op(f->ops[i], f->kinds[i]), inst);
+    if (!first)
+      first = c;
+    if (!pc2code[f->pcs[i]])
+      pc2code[f->pcs[i]] = first;
+
+    c->dst = f->dst[i];
+    c->src = c->op == ELI_JMP_REG ? f->jmp[i] : f->src[i];
+  }
+  add_code(ELI_END, NULL);
+
+  int num_insts_codes = num_codes;
+  for (int i = 0; i < num_insts_codes; i++) {
+    Code* c = &codes[i];
+    if (c->op == ELI_TRACE || !c->inst || c->inst->op < JEQ ||
+        c->inst->op > JMP || c->inst->jmp.type != IMM) {
+      continue;
+    }
+    int npc = c->inst->jmp.imm;
+    if (npc <= max_pc && pc2code[npc]) {
+      c->target = pc2code[npc];
+    } else {
+      c->target = add_code(ELI_BAD_JUMP, c->inst);
+      c->target->src = npc;
+    }
+  }
+}
+
+static Code* jump_to_reg(int r) {
+  int npc = regs[r];
+  if (npc < 0 || npc > max_pc || !pc2code[npc]) {
+    pc = npc;
+    error("jump to invalid pc");
+  }
+  return pc2code[npc];
+}
+
+#ifdef ELI_DIRECT_THREADED
+# define CASE(name) L_##name:
+# define DISPATCH() goto *c->handler
+#else
+# define CASE(name) case ELI_##name:
+# define DISPATCH() continue
+#endif
+#define NEXT() { c++; DISPATCH(); }
+#define JUMP(t) { c = (t); DISPATCH(); }
+#define WRAP(v) ((v) & (MEMSZ - 1))
+
+#define BINOP_HANDLERS(name, expr)                      \
+  CASE(name##_REG_REG) {                                \
+    int s = regs[c->src];                               \
+    regs[c->dst] = expr;                                \
+    NEXT();                                             \
+  }                                                     \
+  CASE(name##_REG_IMM) {                                \
+    int s = c->src;                                     \
+    regs[c->dst] = expr;                                \
+    NEXT();                                             \
+  }
+
+#define JCC_HANDLERS(name, cmp_op)                      \
+  CASE(name##_REG_REG)                                  \
+    if (regs[c->dst] cmp_op regs[c->src])               \
+      JUMP(c->target);                                  \
+    NEXT();                                             \
+  CASE(name##_REG_IMM)                                  \
+    if (regs[c->dst] cmp_op c->src)                     \
+      JUMP(c->target);                                  \
+    NEXT();
+
+static void run(Code* c) {
+#ifdef ELI_DIRECT_THREADED
+#define ELI_OP_LABEL(name) &&L_##name,
+  static void* const labels[] = { ELI_OPS(ELI_OP_LABEL) };
+#undef ELI_OP_LABEL
+  for (int i = 0; i < num_codes; i++) {
+    codes[i].handler = labels[codes[i].op];
+  }
+  DISPATCH();
+#else
+  for (;;) {
+    switch (c->op) {
+#endif
+
+  BINOP_HANDLERS(MOV, s);
+  BINOP_HANDLERS(ADD, WRAP(regs[c->dst] + s));
+  BINOP_HANDLERS(SUB, WRAP(regs[c->dst] - s));
+  BINOP_HANDLERS(LOAD, mem[s]);
+
+  CASE(STORE_REG_REG)
+    mem[regs[c->src]] = regs[c->dst];
+    NEXT();
+  CASE(STORE_REG_IMM)
+    mem[c->src] = regs[c->dst];
+    NEXT();
+
+  CASE(PUTC_REG)
+    putchar(regs[c->src]);
+    NEXT();
+  CASE(PUTC_IMM)
+    putchar(c->src);
+    NEXT();
+
+  CASE(GETC_REG) {
+    int ch = getchar();
+    regs[c->dst] = ch == EOF ? 0 : ch;
+    NEXT();
+  }
+
+  CASE(EXIT)
+    exit(0);
+
+  CASE(DUMP)
+    NEXT();
+
+  BINOP_HANDLERS(EQ, regs[c->dst] == s);
+  BINOP_HANDLERS(NE, regs[c->dst] != s);
+  BINOP_HANDLERS(LT, regs[c->dst] < s);
+  BINOP_HANDLERS(GT, regs[c->dst] > s);
+  BINOP_HANDLERS(LE, regs[c->dst] <= s);
+  BINOP_HANDLERS(GE, regs[c->dst] >= s);
+
+  // Extension operations, see ir.h for the results of corner cases.
+  BINOP_HANDLERS(MUL, (int)(((unsigned int)regs[c->dst] * s) & UINT_MAX));
+  BINOP_HANDLERS(DIV, s ? regs[c->dst] / s : UINT_MAX);
+  BINOP_HANDLERS(MOD, s ? regs[c->dst] % s : regs[c->dst]);
+  BINOP_HANDLERS(AND, regs[c->dst] & s);
+  BINOP_HANDLERS(OR, regs[c->dst] | s);
+  BINOP_HANDLERS(XOR, regs[c->dst] ^ s);
+  BINOP_HANDLERS(SHL, s < 24 ? (int)(((unsigned int)regs[c->dst] << s) &
+                                     UINT_MAX) : 0);
+  BINOP_HANDLERS(SHR, s < 24 ? regs[c->dst] >> s : 0);
+
+  JCC_HANDLERS(JEQ, ==);
+  JCC_HANDLERS(JNE, !=);
+  JCC_HANDLERS(JLT, <);
+  JCC_HANDLERS(JGT, >);
+  JCC_HANDLERS(JLE, <=);
+  JCC_HANDLERS(JGE, >=);
+
+  CASE(JCC_IND)
+    if (cmp(c->inst))
+      JUMP(jump_to_reg(c->inst->jmp.reg));
+    NEXT();
+
+  CASE(JMP_IMM)
+    JUMP(c->target);
+  CASE(JMP_REG)
+    JUMP(jump_to_reg(c->src));
+
+  CASE(TRACE)
+    pc = c->inst->pc;
+    dump_regs(c->inst);
+    dump_inst(c->inst);
+    NEXT();
+
+  CASE(BAD_JUMP)
+    pc = c->src;
+    error("jump to invalid pc");
+
+  CASE(END)
+    error("ran off the end of the program");
+
+#ifndef ELI_DIRECT_THREADED
+    default:
+      error("oops");
+    }
+  }
+#endif
+}
+
 int main(int argc, char* argv[]) {
 #if defined(NOFILE) || defined(__eir__)
   Module* m = load_eir(stdin);
 #else
-  if (argc >= 2 && !strcmp(argv[1], "-v")) {
-    verbose = true;
-    argc--;
-    argv++;
+  int opt_level = 0;
+  for (; argc >= 2 && argv[1][0] == '-'; argc--, argv++) {
+    if (!strcmp(argv[1], "-v")) {
+      verbose = true;
+    } else if (argv[1][1] == 'O' && argv[1][2] >= '0' &&
+               argv[1][2] <= '9' && !argv[1][3]) {
+      opt_level = argv[1][2] - '0';
+    } else {
+      fprintf(stderr, "unknown flag: %s\n", argv[1]);
+      return 1;
+    }
   }
 
   if (argc < 2) {
@@ -100,115 +409,15 @@ int main(int argc, char* argv[]) {
   }
 
   Module* m = load_eir_from_file(argv[1]);
+  optimize_module(m, opt_level);
 #endif
 
-  int i;
-  i = 0;
-  for (Data* d = m->data; d; d = d->next, i++) {
-    mem[i] = d->v;
-  }
-  for (Inst* inst = m->text; inst; i++) {
-    pc = inst->pc;
-    prog[pc] = inst;
-    for (; inst && pc == inst->pc; inst = inst->next) {}
-  }
+  FlatModule* f = flatten_module(m);
+  memcpy(mem, f->data, f->num_data * sizeof(int));
 
+  decode(m, f);
+  free_flat_module(f);
   pc = m->text->pc;
-  for (;;) {
-    Inst* inst = prog[pc];
-    for (; inst; inst = inst->next) {
-      if (verbose) {
-        dump_regs(inst);
-        dump_inst(inst);
-      }
-      int npc = -1;
-      switch (inst->op) {
-        case MOV:
-          assert(inst->dst.type == REG);
-          regs[inst->dst.reg] = src(inst);
-          break;
-
-        case ADD:
-          assert(inst->dst.type == REG);
-          regs[inst->dst.reg] += src(inst);
-          regs[inst->dst.reg] += MEMSZ;
-          regs[inst->dst.reg] %= MEMSZ;
-          break;
-
-        case SUB:
-          assert(inst->dst.type == REG);
-          regs[inst->dst.reg] -= src(inst);
-          regs[inst->dst.reg] += MEMSZ;
-          regs[inst->dst.reg] %= MEMSZ;
-          break;
-
-        case LOAD: {
-          assert(inst->dst.type == REG);
-          int addr = src(inst);
-          if (addr < 0)
-            error("zero page load");
-          regs[inst->dst.reg] = mem[addr];
-          break;
-        }
-
-        case STORE: {
-          assert(inst->dst.type == REG);
-          int addr = src(inst);
-          if (addr < 0)
-            error("zero page store");
-          mem[addr] = regs[inst->dst.reg];
-          break;
-        }
-
-        case PUTC:
-          putchar(src(inst));
-          break;
-
-        case GETC: {
-          int c = getchar();
-          regs[inst->dst.reg] = c == EOF ? 0 : c;
-          regs[inst->dst.reg] += MEMSZ;
-          regs[inst->dst.reg] %= MEMSZ;
-          break;
-        }
-
-        case EXIT:
-          exit(0);
-
-        case DUMP:
-          break;
-
-        case EQ:
-        case NE:
-        case LT:
-        case GT:
-        case LE:
-        case GE:
-          regs[inst->dst.reg] = cmp(inst);
-          break;
-
-        case JEQ:
-        case JNE:
-        case JLT:
-        case JGT:
-        case JLE:
-        case JGE:
-        case JMP:
-          if (cmp(inst)) {
-            npc = value(&inst->jmp);
-          }
-          break;
-
-        default:
-          error("oops");
-      }
-
-      if (npc != -1) {
-        pc = npc;
-        break;
-      }
-    }
-  }
-
+  run(pc2code[pc]);
   return 0;
 }
@@ -0,0 +1,66 @@
+#include <ir/ir.h>
+
+#include <stdlib.h>
+
+static int flat_operand(Value* v, int imm_bit, unsigned char* kinds) {
+  if (v->type == REG)
+    return v->reg;
+  *kinds |= imm_bit;
+  return v->imm;
+}
+
+FlatModule* flatten_module(Module* module) {
+  FlatModule* f = calloc(1, sizeof(FlatModule));
+  int max_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    f->num_insts++;
+    if (max_pc < inst->pc)
+      max_pc = inst->pc;
+  }
+  for (Data* data = module->data; data; data = data->next) {
+    f->num_data++;
+  }
+
+  int n = f->num_insts;
+  f->ops = calloc(n + 1, 1);
+  f->kinds = calloc(n + 1, 1);
+  f->dst = calloc(n + 1, sizeof(int));
+  f->src = calloc(n + 1, sizeof(int));
+  f->jmp = calloc(n + 1, sizeof(int));
+  f->pcs = calloc(n + 1, sizeof(int));
+  f->num_pcs = max_pc + 1;
+  f->pc2index = malloc((max_pc + 2) * sizeof(int));
+  for (int pc = 0; pc <= max_pc; pc++) {
+    f->pc2index[pc] = -1;
+  }
+  f->data = calloc(f->num_data + 1, sizeof(int));
+
+  int i = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next, i++) {
+    f->ops[i] = inst->op;
+    f->dst[i] = flat_operand(&inst->dst, FLAT_DST_IMM, &f->kinds[i]);
+    f->src[i] = flat_operand(&inst->src, FLAT_SRC_IMM, &f->kinds[i]);
+    f->jmp[i] = flat_operand(&inst->jmp, FLAT_JMP_IMM, &f->kinds[i]);
+    f->pcs[i] = inst->pc;
+    if (f->pc2index[inst->pc] < 0)
+      f->pc2index[inst->pc] = i;
+  }
+
+  i = 0;
+  for (Data* data = module->data; data; data = data->next, i++) {
+    f->data[i] = data->v;
+  }
+  return f;
+}
+
+void free_flat_module(FlatModule* f) {
+  free(f->ops);
+  free(f->kinds);
+  free(f->dst);
+  free(f->src);
+  free(f->jmp);
+  free(f->pcs);
+  free(f->pc2index);
+  free(f->data);
+  free(f);
+}
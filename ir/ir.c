@@ -9,6 +9,16 @@
 
 #include <ir/table.h>
 
+#if !defined(NOFILE) && !defined(__eir__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ELVM_USE_MMAP
+#endif
+
+#define READ_BLOCK_SIZE 65536
+
 static bool g_split_basic_block_by_mem = false;
 
 static char g_current_magic_comment[64];
@@ -24,7 +34,9 @@ typedef struct {
   const char* filename;
   int lineno;
   int col;
-  FILE* fp;
+  // The whole input is in memory and scanned with a cursor.
+  const char* cur;
+  const char* end;
   Table* symtab;
   int in_text;
   Inst* text;
@@ -51,7 +63,9 @@ static void ir_error(Parser* p, const char* msg) {
 }
 
 static int ir_getc(Parser* p) {
-  int c = fgetc(p->fp);
+  if (p->cur == p->end)
+    return EOF;
+  int c = (unsigned char)*p->cur++;
   if (c == '\n') {
     p->lineno++;
     p->col = 0;
@@ -62,16 +76,18 @@ static int ir_getc(Parser* p) {
 }
 
 static void ir_ungetc(Parser* p, int c) {
+  if (c == EOF)
+    return;
   if (c == '\n') {
     p->lineno--;
   }
-  ungetc(c, p->fp);
+  p->cur--;
 }
 
 static int peek(Parser* p) {
-  int c = fgetc(p->fp);
-  ungetc(c, p->fp);
-  return c;
+  if (p->cur == p->end)
+    return EOF;
+  return (unsigned char)*p->cur;
 }
 
 static void skip_until_ret(Parser* p) {
@@ -194,69 +210,102 @@ static void serialize_data(Parser* p, DataPrivate* data_root) {
   data_root->next = serialized_root.next;
 }
 
+// Classifies a mnemonic by its length and first character so that at
+// most a couple of strcmp are needed.
 static Op get_op(Parser* p, const char* buf) {
   if (peek(p) == ':')
     return OP_UNSET;
-  if (!strcmp(buf, "mov")) {
-    return MOV;
-  } else if (!strcmp(buf, "add")) {
-    return ADD;
-  } else if (!strcmp(buf, "sub")) {
-    return SUB;
-  } else if (!strcmp(buf, "load")) {
-    return LOAD;
-  } else if (!strcmp(buf, "store")) {
-    return STORE;
-  } else if (!strcmp(buf, "putc")) {
-    return PUTC;
-  } else if (!strcmp(buf, "getc")) {
-    return GETC;
-  } else if (!strcmp(buf, "exit")) {
-    return EXIT;
-  } else if (!strcmp(buf, "dump")) {
-    return DUMP;
-  } else if (!strcmp(buf, "jeq")) {
-    return JEQ;
-  } else if (!strcmp(buf, "jne")) {
-    return JNE;
-  } else if (!strcmp(buf, "jlt")) {
-    return JLT;
-  } else if (!strcmp(buf, "jgt")) {
-    return JGT;
-  } else if (!strcmp(buf, "jle")) {
-    return JLE;
-  } else if (!strcmp(buf, "jge")) {
-    return JGE;
-  } else if (!strcmp(buf, "jmp")) {
-    return JMP;
-  } else if (!strcmp(buf, "eq")) {
-    return EQ;
-  } else if (!strcmp(buf, "ne")) {
-    return NE;
-  } else if (!strcmp(buf, "lt")) {
-    return LT;
-  } else if (!strcmp(buf, "gt")) {
-    return GT;
-  } else if (!strcmp(buf, "le")) {
-    return LE;
-  } else if (!strcmp(buf, "ge")) {
-    return GE;
-  } else if (!strcmp(buf, ".text")) {
-    return (Op)TEXT;
-  } else if (!strcmp(buf, ".data")) {
-    return (Op)DATA;
-  } else if (!strcmp(buf, ".long")) {
-    return (Op)LONG;
-  } else if (!strcmp(buf, ".string")) {
-    return (Op)STRING;
-  } else if (!strcmp(buf, ".file")) {
-    return (Op)FILENAME;
-  } else if (!strcmp(buf, ".loc")) {
-    return (Op)LOC;
+  switch (strlen(buf)) {
+    case 2:
+      switch (buf[0]) {
+        case 'e': return !strcmp(buf, "eq") ? EQ : OP_UNSET;
+        case 'n': return !strcmp(buf, "ne") ? NE : OP_UNSET;
+        case 'o': return buf[1] == 'r' ? OR : OP_UNSET;
+        case 'l':
+          if (buf[1] == 't') return LT;
+          if (buf[1] == 'e') return LE;
+          return OP_UNSET;
+        case 'g':
+          if (buf[1] == 't') return GT;
+          if (buf[1] == 'e') return GE;
+          return OP_UNSET;
+      }
+      break;
+    case 3:
+      switch (buf[0]) {
+        case 'm':
+          if (!strcmp(buf, "mov")) return MOV;
+          if (!strcmp(buf, "mul")) return MUL;
+          if (!strcmp(buf, "mod")) return MOD;
+          return OP_UNSET;
+        case 'a':
+          if (!strcmp(buf, "add")) return ADD;
+          if (!strcmp(buf, "and")) return AND;
+          return OP_UNSET;
+        case 's':
+          if (!strcmp(buf, "sub")) return SUB;
+          if (!strcmp(buf, "shl")) return SHL;
+          if (!strcmp(buf, "shr")) return SHR;
+          return OP_UNSET;
+        case 'd': return !strcmp(buf, "div") ? DIV : OP_UNSET;
+        case 'x': return !strcmp(buf, "xor") ? XOR : OP_UNSET;
+        case 'j':
+          if (!strcmp(buf, "jeq")) return JEQ;
+          if (!strcmp(buf, "jne")) return JNE;
+          if (!strcmp(buf, "jlt")) return JLT;
+          if (!strcmp(buf, "jgt")) return JGT;
+          if (!strcmp(buf, "jle")) return JLE;
+          if (!strcmp(buf, "jge")) return JGE;
+          if (!strcmp(buf, "jmp")) return JMP;
+          return OP_UNSET;
+      }
+      break;
+    case 4:
+      switch (buf[0]) {
+        case 'l': return !strcmp(buf, "load") ? LOAD : OP_UNSET;
+        case 'p': return !strcmp(buf, "putc") ? PUTC : OP_UNSET;
+        case 'g': return !strcmp(buf, "getc") ? GETC : OP_UNSET;
+        case 'e': return !strcmp(buf, "exit") ? EXIT : OP_UNSET;
+        case 'd': return !strcmp(buf, "dump") ? DUMP : OP_UNSET;
+        case '.': return !strcmp(buf, ".loc") ? (Op)LOC : OP_UNSET;
+      }
+      break;
+    case 5:
+      switch (buf[0]) {
+        case 's': return !strcmp(buf, "store") ? STORE : OP_UNSET;
+        case '.':
+          if (!strcmp(buf, ".text")) return (Op)TEXT;
+          if (!strcmp(buf, ".data")) return (Op)DATA;
+          if (!strcmp(buf, ".long")) return (Op)LONG;
+          if (!strcmp(buf, ".file")) return (Op)FILENAME;
+          return OP_UNSET;
+      }
+      break;
+    case 7:
+      return !strcmp(buf, ".string") ? (Op)STRING : OP_UNSET;
   }
   return OP_UNSET;
 }
 
+static bool get_reg(const char* buf, Reg* reg) {
+  if (buf[1] == 0) {
+    if (buf[0] >= 'A' && buf[0] <= 'D') {
+      *reg = (Reg)(A + buf[0] - 'A');
+      return true;
+    }
+  } else if (buf[2] == 0) {
+    if (buf[0] == 'S' && buf[1] == 'P') {
+      *reg = SP;
+      return true;
+    }
+    if (buf[0] == 'B' && buf[1] == 'P') {
+      *reg = BP;
+      return true;
+    }
+  }
+  return false;
+}
+
 static void parse_line(Parser* p, int c) {
   char buf[64];
   buf[0] = c;
@@ -329,7 +378,7 @@ static void parse_line(Parser* p, int c) {
           p->pc++;
         value = p->pc;
         p->prev_boundary = true;
-        p->symtab = table_add(p->symtab, strdup(buf), (void*)value);
+        p->symtab = table_add(p->symtab, buf, (void*)value);
       } else {
         DataPrivate* d = add_data(p);
         d->val.type = (ValueType)LABEL;
@@ -358,6 +407,8 @@ static void parse_line(Parser* p, int c) {
     argc = 2;
   else if (op == DUMP)
     argc = 0;
+  else if (is_ext_op(op))
+    argc = 2;
   else if (op == (Op)LONG)
     argc = 1;
   else if (op == (Op)DATA) {
@@ -386,19 +437,7 @@ static void parse_line(Parser* p, int c) {
       buf[0] = c;
       read_while_ident(p, buf + 1, 62);
       a.type = REG;
-      if (!strcmp(buf, "A")) {
-        a.reg = A;
-      } else if (!strcmp(buf, "B")) {
-        a.reg = B;
-      } else if (!strcmp(buf, "C")) {
-        a.reg = C;
-      } else if (!strcmp(buf, "D")) {
-        a.reg = D;
-      } else if (!strcmp(buf, "SP")) {
-        a.reg = SP;
-      } else if (!strcmp(buf, "BP")) {
-        a.reg = BP;
-      } else {
+      if (!get_reg(buf, &a.reg)) {
         a.type = (ValueType)REF;
         a.tmp = strdup(buf);
       }
@@ -454,6 +493,14 @@ static void parse_line(Parser* p, int c) {
     case GT:
     case LE:
     case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
       p->text->src = args[1];
       FALLTHROUGH;
     case GETC:
@@ -562,10 +609,247 @@ static void resolve_syms(Parser* p) {
   }
 }
 
-Module* load_eir_impl(const char* filename, FILE* fp) {
+// Reads the whole stream in large blocks.
+static char* read_all(FILE* fp, int* len) {
+  int cap = READ_BLOCK_SIZE;
+  char* buf = malloc(cap);
+  int n = 0;
+  for (;;) {
+    if (n + READ_BLOCK_SIZE > cap) {
+      char* nbuf = malloc(cap * 2);
+      memcpy(nbuf, buf, n);
+      free(buf);
+      buf = nbuf;
+      cap *= 2;
+    }
+#ifdef __eir__
+    int r = 0;
+    for (; r < READ_BLOCK_SIZE; r++) {
+      int c = fgetc(fp);
+      if (c == EOF)
+        break;
+      buf[n + r] = c;
+    }
+#else
+    int r = fread(buf + n, 1, READ_BLOCK_SIZE, fp);
+#endif
+    n += r;
+    if (r < READ_BLOCK_SIZE)
+      break;
+  }
+  *len = n;
+  return buf;
+}
+
+// The binary EIR (.eirb) format. All integers are 32-bit little endian.
+//
+//   magic "\x7f" "EIRB", version, flags, #insts, #data
+//   insts: op | dst type << 8 | src type << 16 | jmp type << 24,
+//          pc, dst, src, jmp
+//   data: v
+//   line table (EIRB_HAS_LINES): lineno for each inst
+//   magic comments (EIRB_HAS_MAGIC_COMMENTS): #comments, then
+//     inst index, length, and bytes for each comment
+//
+// Everything is already resolved, so loading needs no symbol table.
+
+static const char EIRB_MAGIC[] = "\x7f" "EIRB";
+#define EIRB_VERSION 1
+#define EIRB_HEADER_SIZE 20
+#define EIRB_INST_SIZE 20
+
+enum {
+  EIRB_HAS_LINES = 1,
+  EIRB_HAS_MAGIC_COMMENTS = 2
+};
+
+static void eirb_put32(int v, FILE* fp) {
+  unsigned int u = v;
+  fputc(u % 256, fp);
+  fputc(u / 256 % 256, fp);
+  fputc(u / 65536 % 256, fp);
+  fputc(u / 16777216 % 256, fp);
+}
+
+static int eirb_value(Value* v) {
+  return v->type == REG ? (int)v->reg : v->imm;
+}
+
+void dump_eirb(Module* module, FILE* fp) {
+  int num_insts = 0;
+  int num_data = 0;
+  int num_comments = 0;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    num_insts++;
+    if (inst->magic_comment)
+      num_comments++;
+  }
+  for (Data* data = module->data; data; data = data->next) {
+    num_data++;
+  }
+
+  for (int i = 0; i < 4; i++)
+    fputc(EIRB_MAGIC[i], fp);
+  eirb_put32(EIRB_VERSION, fp);
+  eirb_put32(EIRB_HAS_LINES | (num_comments ? EIRB_HAS_MAGIC_COMMENTS : 0),
+             fp);
+  eirb_put32(num_insts, fp);
+  eirb_put32(num_data, fp);
+
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    fputc(inst->op, fp);
+    fputc(inst->dst.type, fp);
+    fputc(inst->src.type, fp);
+    fputc(inst->jmp.type, fp);
+    eirb_put32(inst->pc, fp);
+    eirb_put32(eirb_value(&inst->dst), fp);
+    eirb_put32(eirb_value(&inst->src), fp);
+    eirb_put32(eirb_value(&inst->jmp), fp);
+  }
+  for (Data* data = module->data; data; data = data->next) {
+    eirb_put32(data->v, fp);
+  }
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    eirb_put32(inst->lineno, fp);
+  }
+  if (num_comments) {
+    eirb_put32(num_comments, fp);
+    int i = 0;
+    for (Inst* inst = module->text; inst; inst = inst->next, i++) {
+      if (!inst->magic_comment)
+        continue;
+      int len = strlen(inst->magic_comment);
+      eirb_put32(i, fp);
+      eirb_put32(len, fp);
+      for (int j = 0; j < len; j++)
+        fputc(inst->magic_comment[j], fp);
+    }
+  }
+}
+
+typedef struct {
+  const char* filename;
+  const unsigned char* cur;
+  const unsigned char* end;
+} EirbReader;
+
+static int eirb_get32(EirbReader* r) {
+  if (r->end - r->cur < 4) {
+    fprintf(stderr, "%s: truncated eirb\n", r->filename);
+    exit(1);
+  }
+  const unsigned char* b = r->cur;
+  r->cur += 4;
+  return (int)(b[0] + b[1] * 256 + b[2] * 65536 +
+               (unsigned int)b[3] * 16777216);
+}
+
+static void eirb_set_value(EirbReader* r, Value* v, int type, int x) {
+  if (type == REG) {
+    if (x < A || x > SP) {
+      fprintf(stderr, "%s: broken eirb register\n", r->filename);
+      exit(1);
+    }
+    v->type = REG;
+    v->reg = (Reg)x;
+  } else {
+    v->type = IMM;
+    v->imm = x;
+  }
+}
+
+static bool is_eirb(const char* buf, int len) {
+  if (len < EIRB_HEADER_SIZE)
+    return false;
+  for (int i = 0; i < 4; i++) {
+    if (buf[i] != EIRB_MAGIC[i])
+      return false;
+  }
+  return true;
+}
+
+// Instructions and data are allocated in two arrays and linked, so the
+// cost is proportional to the file size.
+static Module* load_eirb(const char* filename, const char* buf, int len) {
+  EirbReader r = {
+    .filename = filename,
+    .cur = (const unsigned char*)buf + 4,
+    .end = (const unsigned char*)buf + len
+  };
+  if (eirb_get32(&r) != EIRB_VERSION) {
+    fprintf(stderr, "%s: unsupported eirb version\n", filename);
+    exit(1);
+  }
+  int flags = eirb_get32(&r);
+  int num_insts = eirb_get32(&r);
+  int num_data = eirb_get32(&r);
+  if (num_insts < 0 || num_data < 0 ||
+      (r.end - r.cur) / EIRB_INST_SIZE < num_insts) {
+    fprintf(stderr, "%s: truncated eirb\n", filename);
+    exit(1);
+  }
+
+  Inst* insts = calloc(num_insts + 1, sizeof(Inst));
+  for (int i = 0; i < num_insts; i++) {
+    Inst* inst = &insts[i];
+    const unsigned char* types = r.cur;
+    r.cur += 4;
+    inst->op = (Op)types[0];
+    if (inst->op < MOV || inst->op >= LAST_OP) {
+      fprintf(stderr, "%s: broken eirb op\n", filename);
+      exit(1);
+    }
+    inst->pc = eirb_get32(&r);
+    eirb_set_value(&r, &inst->dst, types[1], eirb_get32(&r));
+    eirb_set_value(&r, &inst->src, types[2], eirb_get32(&r));
+    eirb_set_value(&r, &inst->jmp, types[3], eirb_get32(&r));
+    inst->next = i + 1 < num_insts ? &insts[i + 1] : NULL;
+  }
+
+  Data* data = calloc(num_data + 1, sizeof(Data));
+  for (int i = 0; i < num_data; i++) {
+    data[i].v = eirb_get32(&r);
+    data[i].next = i + 1 < num_data ? &data[i + 1] : NULL;
+  }
+
+  if (flags & EIRB_HAS_LINES) {
+    for (int i = 0; i < num_insts; i++) {
+      insts[i].lineno = eirb_get32(&r);
+    }
+  }
+
+  if (flags & EIRB_HAS_MAGIC_COMMENTS) {
+    int num_comments = eirb_get32(&r);
+    for (int i = 0; i < num_comments; i++) {
+      int index = eirb_get32(&r);
+      int clen = eirb_get32(&r);
+      if (index < 0 || index >= num_insts || clen < 0 ||
+          r.end - r.cur < clen) {
+        fprintf(stderr, "%s: broken eirb magic comment\n", filename);
+        exit(1);
+      }
+      char* comment = malloc(clen + 1);
+      memcpy(comment, r.cur, clen);
+      comment[clen] = 0;
+      r.cur += clen;
+      insts[index].magic_comment = comment;
+    }
+  }
+
+  Module* m = malloc(sizeof(Module));
+  m->text = num_insts ? insts : NULL;
+  m->data = num_data ? data : NULL;
+  return m;
+}
+
+static Module* load_eir_impl(const char* filename, const char* buf, int len) {
+  if (is_eirb(buf, len))
+    return load_eirb(filename, buf, len);
+
   Parser parser = {
     .filename = filename,
-    .fp = fp
+    .cur = buf,
+    .end = buf + len
   };
   parse_eir(&parser);
   resolve_syms(&parser);
@@ -577,17 +861,42 @@ Module* load_eir_impl(const char* filename, FILE* fp) {
 }
 
 Module* load_eir(FILE* fp) {
-  return load_eir_impl("<stdin>", fp);
+  int len;
+  char* buf = read_all(fp, &len);
+  Module* r = load_eir_impl("<stdin>", buf, len);
+  free(buf);
+  return r;
 }
 
 Module* load_eir_from_file(const char* filename) {
+#ifdef ELVM_USE_MMAP
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "no such file: %s\n", filename);
+    exit(1);
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    char* buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf != MAP_FAILED) {
+      close(fd);
+      Module* r = load_eir_impl(filename, buf, st.st_size);
+      munmap(buf, st.st_size);
+      return r;
+    }
+  }
+  close(fd);
+#endif
   FILE* fp = fopen(filename, "r");
   if (!fp) {
     fprintf(stderr, "no such file: %s\n", filename);
     exit(1);
   }
-  Module* r = load_eir_impl(filename, fp);
+  int len;
+  char* buf = read_all(fp, &len);
   fclose(fp);
+  Module* r = load_eir_impl(filename, buf, len);
+  free(buf);
   return r;
 }
 
@@ -595,11 +904,16 @@ void split_basic_block_by_mem() {
   g_split_basic_block_by_mem = true;
 }
 
+bool is_split_basic_block_by_mem() {
+  return g_split_basic_block_by_mem;
+}
+
 void dump_op(Op op, FILE* fp) {
   static const char* op_strs[] = {
     "mov", "add", "sub", "load", "store", "putc", "getc", "exit",
     "jeq", "jne", "jlt", "jgt", "jle", "jge", "jmp", "xxx",
-    "eq", "ne", "lt", "gt", "le", "ge", "dump"
+    "eq", "ne", "lt", "gt", "le", "ge", "dump",
+    "mul", "div", "mod", "and", "or", "xor", "shl", "shr"
   };
   fprintf(fp, "%s", op_strs[op]);
 }
@@ -631,6 +945,14 @@ void dump_inst_fp(Inst* inst, FILE* fp) {
     case GT:
     case LE:
     case GE:
+    case MUL:
+    case DIV:
+    case MOD:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
       fprintf(fp, " ");
       dump_val(&inst->dst, fp);
       fprintf(fp, " ");
@@ -1,6 +1,7 @@
 #ifndef ELVM_IR_H_
 #define ELVM_IR_H_
 
+#include <stdbool.h>
 #include <stdio.h>
 
 #define UINT_MAX 16777215
@@ -25,6 +26,10 @@ typedef enum {
   JEQ = 8, JNE, JLT, JGT, JLE, JGE, JMP,
   // Optional operations follow.
   EQ = 16, NE, LT, GT, LE, GE, DUMP,
+  // Extension operations. They compute dst = dst OP src on unsigned
+  // words. Shifts by 24 or more give 0, x / 0 gives UINT_MAX, and
+  // x % 0 gives x. Backends without them run lower_ext_ops first.
+  MUL = 23, DIV, MOD, AND, OR, XOR, SHL, SHR,
   LAST_OP
 } Op;
 
@@ -58,11 +63,59 @@ typedef struct {
   Data* data;
 } Module;
 
+// A contiguous struct-of-arrays view of a Module, which is cheaper to
+// walk than the linked lists. Instruction i has opcode ops[i] and its
+// operands are dst[i], src[i], and jmp[i]. Each operand is a register
+// number unless the corresponding FLAT_*_IMM bit is set in kinds[i].
+typedef struct {
+  int num_insts;
+  unsigned char* ops;
+  unsigned char* kinds;
+  int* dst;
+  int* src;
+  int* jmp;
+  int* pcs;
+  // The index of the first instruction of each pc, or -1.
+  int num_pcs;
+  int* pc2index;
+  int num_data;
+  int* data;
+} FlatModule;
+
+enum {
+  FLAT_DST_IMM = 1, FLAT_SRC_IMM = 2, FLAT_JMP_IMM = 4
+};
+
 Module* load_eir(FILE* fp);
 
+// Both loaders accept the textual EIR and the binary format written by
+// dump_eirb, which is detected by its magic number.
 Module* load_eir_from_file(const char* filename);
 
+// Writes |module| in the binary EIR format (.eirb).
+void dump_eirb(Module* module, FILE* fp);
+
+// Builds the flat view of |module|. The result does not follow later
+// changes to |module|.
+FlatModule* flatten_module(Module* module);
+void free_flat_module(FlatModule* f);
+
+// Optimizes |module| in place. Level 1 simplifies each basic block and
+// level 2 also threads jumps and removes unreachable basic blocks.
+void optimize_module(Module* module, int level);
+
+// Expands extension operations (MUL ... SHR) into loops of basic
+// operations. New basic blocks are appended after the last pc, and the
+// memory right below SP is used to spill registers.
+void lower_ext_ops(Module* module);
+
+// Evaluates an extension operation in the same way as lower_ext_ops.
+int eval_ext_op(Op op, int x, int y);
+
+bool is_ext_op(Op op);
+
 void split_basic_block_by_mem();
+bool is_split_basic_block_by_mem();
 
 void dump_inst(Inst* inst);
 void dump_inst_fp(Inst* inst, FILE* fp);
@@ -0,0 +1,364 @@
+#include <ir/ir.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Expands extension operations into basic EIR for backends which do
+// not have native ones.
+//
+// "op d, s" is replaced by a jump to freshly numbered basic blocks at
+// the end of the module. They spill all registers below SP, run a loop
+// over the 24 bits with x in A and y in B, write the result back to the
+// slot of d, restore registers, and continue with the rest of the
+// original basic block. Existing pcs are never renumbered.
+
+#define LOWER_TOP_BIT 8388608
+#define LOWER_MAX_LABELS 8
+
+typedef struct {
+  Inst* orig;
+  Inst root;
+  Inst* tail;
+  int pc;
+  bool pc_used;
+  int labels[LOWER_MAX_LABELS];
+  // Jumps whose jmp.imm is a label ID until lower_patch.
+  Inst* fixups[32];
+  int num_fixups;
+} Lowerer;
+
+// Stack slot of each register, relative to SP after the spill.
+static const int lower_slots[6] = { 5, 4, 3, 2, 1, 0 };
+
+static Inst* lower_add(Lowerer* l, Op op) {
+  Inst* inst = calloc(1, sizeof(Inst));
+  inst->op = op;
+  inst->pc = l->pc;
+  inst->lineno = l->orig->lineno;
+  l->tail->next = inst;
+  l->tail = inst;
+  l->pc_used = true;
+  return inst;
+}
+
+static void lower_end_block(Lowerer* l) {
+  if (l->pc_used) {
+    l->pc++;
+    l->pc_used = false;
+  }
+}
+
+static void lower_reg_reg(Lowerer* l, Op op, Reg dst, Reg src) {
+  Inst* inst = lower_add(l, op);
+  inst->dst.type = REG;
+  inst->dst.reg = dst;
+  inst->src.type = REG;
+  inst->src.reg = src;
+  if ((op == LOAD || op == STORE) && is_split_basic_block_by_mem())
+    lower_end_block(l);
+}
+
+static void lower_reg_imm(Lowerer* l, Op op, Reg dst, int imm) {
+  Inst* inst = lower_add(l, op);
+  inst->dst.type = REG;
+  inst->dst.reg = dst;
+  inst->src.type = IMM;
+  inst->src.imm = imm;
+}
+
+static void lower_label(Lowerer* l, int id) {
+  lower_end_block(l);
+  l->labels[id] = l->pc;
+}
+
+// Emits "op label, dst, src" where src is an immediate.
+static void lower_jcc_imm(Lowerer* l, Op op, int label, Reg dst, int imm) {
+  Inst* inst = lower_add(l, op);
+  inst->jmp.type = IMM;
+  inst->jmp.imm = label;
+  inst->dst.type = REG;
+  inst->dst.reg = dst;
+  inst->src.type = IMM;
+  inst->src.imm = imm;
+  l->fixups[l->num_fixups++] = inst;
+  lower_end_block(l);
+}
+
+static void lower_jcc_reg(Lowerer* l, Op op, int label, Reg dst, Reg src) {
+  lower_jcc_imm(l, op, label, dst, 0);
+  l->tail->src.type = REG;
+  l->tail->src.reg = src;
+}
+
+static void lower_jmp(Lowerer* l, int label) {
+  lower_jcc_imm(l, JMP, label, A, 0);
+}
+
+static void lower_patch(Lowerer* l) {
+  for (int i = 0; i < l->num_fixups; i++) {
+    Inst* inst = l->fixups[i];
+    inst->jmp.imm = l->labels[inst->jmp.imm];
+  }
+}
+
+static void lower_spill(Lowerer* l) {
+  for (int r = A; r <= BP; r++) {
+    lower_reg_imm(l, SUB, SP, 1);
+    lower_reg_reg(l, STORE, (Reg)r, SP);
+  }
+  lower_reg_reg(l, MOV, A, SP);
+  lower_reg_imm(l, ADD, A, 5);
+  lower_reg_imm(l, SUB, SP, 1);
+  lower_reg_reg(l, STORE, A, SP);
+}
+
+static void lower_load_slot(Lowerer* l, Reg dst, Reg r) {
+  lower_reg_reg(l, MOV, dst, SP);
+  lower_reg_imm(l, ADD, dst, lower_slots[r]);
+  lower_reg_reg(l, LOAD, dst, dst);
+}
+
+static void lower_restore(Lowerer* l, Reg d) {
+  lower_reg_reg(l, MOV, C, SP);
+  lower_reg_imm(l, ADD, C, lower_slots[d]);
+  lower_reg_reg(l, STORE, A, C);
+  for (int r = BP; r >= A; r--) {
+    lower_reg_reg(l, MOV, A, SP);
+    lower_reg_imm(l, ADD, A, lower_slots[r]);
+    lower_reg_reg(l, LOAD, (Reg)r, A);
+  }
+  lower_reg_reg(l, LOAD, SP, SP);
+}
+
+// A = A * B
+static void lower_mul(Lowerer* l) {
+  enum { LOOP, SKIP };
+  lower_reg_imm(l, MOV, C, 0);
+  lower_reg_imm(l, MOV, D, 24);
+  lower_label(l, LOOP);
+  lower_reg_reg(l, ADD, C, C);
+  lower_jcc_imm(l, JLT, SKIP, B, LOWER_TOP_BIT);
+  lower_reg_imm(l, SUB, B, LOWER_TOP_BIT);
+  lower_reg_reg(l, ADD, C, A);
+  lower_label(l, SKIP);
+  lower_reg_reg(l, ADD, B, B);
+  lower_reg_imm(l, SUB, D, 1);
+  lower_jcc_imm(l, JNE, LOOP, D, 0);
+  lower_reg_reg(l, MOV, A, C);
+}
+
+// A = A / B or A % B by the restoring division. The remainder in D
+// may not fit in a word after doubling, in which case it is surely
+// larger than B.
+static void lower_divmod(Lowerer* l, Op op) {
+  enum { LOOP, NO_BIT, NO_SUB, NEXT, BIG, BIG_NO_BIT, END };
+  lower_reg_imm(l, MOV, C, 0);
+  lower_reg_imm(l, MOV, D, 0);
+  lower_reg_imm(l, MOV, BP, 24);
+  lower_label(l, LOOP);
+  lower_reg_reg(l, ADD, C, C);
+  lower_jcc_imm(l, JGE, BIG, D, LOWER_TOP_BIT);
+  lower_reg_reg(l, ADD, D, D);
+  lower_jcc_imm(l, JLT, NO_BIT, A, LOWER_TOP_BIT);
+  lower_reg_imm(l, SUB, A, LOWER_TOP_BIT);
+  lower_reg_imm(l, ADD, D, 1);
+  lower_label(l, NO_BIT);
+  lower_reg_reg(l, ADD, A, A);
+  lower_jcc_reg(l, JLT, NO_SUB, D, B);
+  lower_reg_reg(l, SUB, D, B);
+  lower_reg_imm(l, ADD, C, 1);
+  lower_label(l, NO_SUB);
+  lower_label(l, NEXT);
+  lower_reg_imm(l, SUB, BP, 1);
+  lower_jcc_imm(l, JNE, LOOP, BP, 0);
+  lower_jmp(l, END);
+  lower_label(l, BIG);
+  lower_reg_reg(l, ADD, D, D);
+  lower_jcc_imm(l, JLT, BIG_NO_BIT, A, LOWER_TOP_BIT);
+  lower_reg_imm(l, SUB, A, LOWER_TOP_BIT);
+  lower_reg_imm(l, ADD, D, 1);
+  lower_label(l, BIG_NO_BIT);
+  lower_reg_reg(l, ADD, A, A);
+  lower_reg_reg(l, SUB, D, B);
+  lower_reg_imm(l, ADD, C, 1);
+  lower_jmp(l, NEXT);
+  lower_label(l, END);
+  lower_reg_reg(l, MOV, A, op == DIV ? C : D);
+}
+
+// A = A & B, A | B, or A ^ B. BP counts the set bits at each position.
+static void lower_bitwise(Lowerer* l, Op op) {
+  enum { LOOP, NO_A, NO_B, SKIP };
+  lower_reg_imm(l, MOV, C, 0);
+  lower_reg_imm(l, MOV, D, 24);
+  lower_label(l, LOOP);
+  lower_reg_reg(l, ADD, C, C);
+  lower_reg_imm(l, MOV, BP, 0);
+  lower_jcc_imm(l, JLT, NO_A, A, LOWER_TOP_BIT);
+  lower_reg_imm(l, SUB, A, LOWER_TOP_BIT);
+  lower_reg_imm(l, ADD, BP, 1);
+  lower_label(l, NO_A);
+  lower_jcc_imm(l, JLT, NO_B, B, LOWER_TOP_BIT);
+  lower_reg_imm(l, SUB, B, LOWER_TOP_BIT);
+  lower_reg_imm(l, ADD, BP, 1);
+  lower_label(l, NO_B);
+  lower_reg_reg(l, ADD, A, A);
+  lower_reg_reg(l, ADD, B, B);
+  if (op == AND)
+    lower_jcc_imm(l, JNE, SKIP, BP, 2);
+  else if (op == OR)
+    lower_jcc_imm(l, JEQ, SKIP, BP, 0);
+  else
+    lower_jcc_imm(l, JNE, SKIP, BP, 1);
+  lower_reg_imm(l, ADD, C, 1);
+  lower_label(l, SKIP);
+  lower_reg_imm(l, SUB, D, 1);
+  lower_jcc_imm(l, JNE, LOOP, D, 0);
+  lower_reg_reg(l, MOV, A, C);
+}
+
+// A = A << B
+static void lower_shl(Lowerer* l) {
+  enum { LOOP, ZERO, END };
+  lower_jcc_imm(l, JGE, ZERO, B, 24);
+  lower_label(l, LOOP);
+  lower_jcc_imm(l, JEQ, END, B, 0);
+  lower_reg_reg(l, ADD, A, A);
+  lower_reg_imm(l, SUB, B, 1);
+  lower_jmp(l, LOOP);
+  lower_label(l, ZERO);
+  lower_reg_imm(l, MOV, A, 0);
+  lower_label(l, END);
+}
+
+// A = A >> B, which takes the top 24 - B bits of A.
+static void lower_shr(Lowerer* l) {
+  enum { LOOP, NO_BIT, ZERO, END };
+  lower_jcc_imm(l, JGE, ZERO, B, 24);
+  lower_reg_imm(l, MOV, C, 0);
+  lower_reg_imm(l, MOV, D, 24);
+  lower_reg_reg(l, SUB, D, B);
+  lower_label(l, LOOP);
+  lower_jcc_imm(l, JEQ, END, D, 0);
+  lower_reg_reg(l, ADD, C, C);
+  lower_jcc_imm(l, JLT, NO_BIT, A, LOWER_TOP_BIT);
+  lower_reg_imm(l, SUB, A, LOWER_TOP_BIT);
+  lower_reg_imm(l, ADD, C, 1);
+  lower_label(l, NO_BIT);
+  lower_reg_reg(l, ADD, A, A);
+  lower_reg_imm(l, SUB, D, 1);
+  lower_jmp(l, LOOP);
+  lower_label(l, ZERO);
+  lower_reg_imm(l, MOV, C, 0);
+  lower_label(l, END);
+  lower_reg_reg(l, MOV, A, C);
+}
+
+bool is_ext_op(Op op) {
+  return op >= MUL && op <= SHR;
+}
+
+int eval_ext_op(Op op, int x, int y) {
+  unsigned int a = (unsigned int)x & UINT_MAX;
+  unsigned int b = (unsigned int)y & UINT_MAX;
+  switch (op) {
+    case MUL: return (a * b) & UINT_MAX;
+    case DIV: return b ? a / b : UINT_MAX;
+    case MOD: return b ? a % b : a;
+    case AND: return a & b;
+    case OR: return a | b;
+    case XOR: return a ^ b;
+    case SHL: return b < 24 ? (a << b) & UINT_MAX : 0;
+    case SHR: return b < 24 ? a >> b : 0;
+    default: return 0;
+  }
+}
+
+// Lowers |inst| into new basic blocks starting at |pc|, which are
+// appended after |*tail|. The instructions after |inst| in the same
+// basic block are moved to the last new block. Returns the next
+// available pc.
+static int lower_inst(Inst* inst, int pc, int last_orig_pc, Inst** tail) {
+  Lowerer l = {};
+  l.orig = inst;
+  l.tail = &l.root;
+  l.pc = pc;
+
+  int orig_pc = inst->pc;
+  Inst* rest = inst->next;
+  Inst* rest_last = inst;
+  while (rest_last->next && rest_last->next->pc == orig_pc)
+    rest_last = rest_last->next;
+  Inst* after = rest_last->next;
+  bool falls_through = rest_last->op != JMP && rest_last->op != EXIT;
+  if (rest_last == inst)
+    rest = NULL;
+
+  Reg d = inst->dst.reg;
+  lower_spill(&l);
+  lower_load_slot(&l, A, d);
+  if (inst->src.type == REG)
+    lower_load_slot(&l, B, inst->src.reg);
+  else
+    lower_reg_imm(&l, MOV, B, inst->src.imm);
+
+  switch (inst->op) {
+    case MUL: lower_mul(&l); break;
+    case DIV:
+    case MOD: lower_divmod(&l, inst->op); break;
+    case AND:
+    case OR:
+    case XOR: lower_bitwise(&l, inst->op); break;
+    case SHL: lower_shl(&l); break;
+    case SHR: lower_shr(&l); break;
+    default: break;
+  }
+  lower_restore(&l, d);
+  lower_patch(&l);
+
+  for (Inst* p = rest; p; p = p->next) {
+    p->pc = l.pc;
+    if (p == rest_last)
+      break;
+  }
+  if (rest) {
+    l.tail->next = rest;
+    l.tail = rest_last;
+    if (rest_last->op >= JEQ && rest_last->op <= JGE)
+      l.pc++;
+  }
+  if (falls_through) {
+    Inst* j = lower_add(&l, orig_pc < last_orig_pc ? JMP : EXIT);
+    j->jmp.type = IMM;
+    j->jmp.imm = orig_pc + 1;
+  }
+  l.tail->next = NULL;
+
+  // The original instruction becomes a jump to the new blocks.
+  inst->op = JMP;
+  inst->jmp.type = IMM;
+  inst->jmp.imm = pc;
+  inst->next = after;
+
+  if (*tail == rest_last)
+    *tail = inst;
+  (*tail)->next = l.root.next;
+  *tail = l.tail;
+  return l.pc + 1;
+}
+
+void lower_ext_ops(Module* module) {
+  int max_pc = -1;
+  Inst* tail = NULL;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (max_pc < inst->pc)
+      max_pc = inst->pc;
+    tail = inst;
+  }
+  int last_orig_pc = max_pc;
+  int pc = max_pc + 1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (is_ext_op(inst->op))
+      pc = lower_inst(inst, pc, last_orig_pc, &tail);
+  }
+}
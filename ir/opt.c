@@ -0,0 +1,417 @@
+#include <ir/cfg.h>
+#include <ir/ir.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// An IR-to-IR optimizer shared by all backends.
+//
+// Every instruction in a basic block has the same pc and only the first
+// instruction of a pc can be a jump destination, so each pc is handled
+// as a basic block. Passes never renumber pcs nor leave a pc without
+// instructions, because immediates and data may hold code addresses.
+// For the same reason, any immediate value which is not a direct jump
+// destination is treated as a possible address of a basic block.
+
+enum {
+  OPT_DEAD = LAST_OP + 1
+};
+
+enum {
+  OPT_UNKNOWN, OPT_CONST, OPT_COPY
+};
+
+typedef struct {
+  int kind;
+  int v;
+} OptReg;
+
+// What we know about one memory word in the current basic block.
+typedef struct {
+  bool valid;
+  Value addr;
+  Reg reg;
+} OptMem;
+
+typedef struct {
+  OptReg regs[6];
+  OptMem mem;
+} OptState;
+
+static bool opt_is_jump(Op op) {
+  return op >= JEQ && op <= JMP;
+}
+
+static bool opt_is_cmp(Op op) {
+  return op >= EQ && op <= GE;
+}
+
+static bool opt_same_value(Value* a, Value* b) {
+  if (a->type != b->type)
+    return false;
+  return a->type == REG ? a->reg == b->reg : a->imm == b->imm;
+}
+
+static void opt_reset(OptState* s) {
+  memset(s, 0, sizeof(*s));
+}
+
+// Forgets everything which depends on the value of |r|.
+static void opt_clobber(OptState* s, Reg r) {
+  s->regs[r].kind = OPT_UNKNOWN;
+  for (int i = 0; i < 6; i++) {
+    if (s->regs[i].kind == OPT_COPY && s->regs[i].v == (int)r)
+      s->regs[i].kind = OPT_UNKNOWN;
+  }
+  if (s->mem.reg == r ||
+      (s->mem.addr.type == REG && s->mem.addr.reg == r)) {
+    s->mem.valid = false;
+  }
+}
+
+static void opt_lookup(OptState* s, Value* v) {
+  if (v->type != REG)
+    return;
+  OptReg* r = &s->regs[v->reg];
+  if (r->kind == OPT_CONST) {
+    v->type = IMM;
+    v->imm = r->v;
+  } else if (r->kind == OPT_COPY) {
+    v->reg = (Reg)r->v;
+  }
+}
+
+// Returns the register which holds the same value as |r|.
+static Reg opt_root(OptState* s, Reg r) {
+  if (s->regs[r].kind == OPT_COPY)
+    return (Reg)s->regs[r].v;
+  return r;
+}
+
+static bool opt_eval_cmp(Op op, int d, int v) {
+  if (op >= EQ)
+    op -= 8;
+  switch (op) {
+    case JEQ: return d == v;
+    case JNE: return d != v;
+    case JLT: return d < v;
+    case JGT: return d > v;
+    case JLE: return d <= v;
+    case JGE: return d >= v;
+    default: return true;
+  }
+}
+
+static void opt_set_mov_imm(Inst* inst, int v) {
+  inst->op = MOV;
+  inst->src.type = IMM;
+  inst->src.imm = v;
+}
+
+static void opt_kill(Inst* inst) {
+  if (!inst->magic_comment)
+    inst->op = (Op)OPT_DEAD;
+}
+
+// Constant and copy propagation, redundant load elimination, and
+// peephole simplification within each basic block.
+static void opt_propagate(Module* module) {
+  OptState s;
+  int prev_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (inst->pc != prev_pc)
+      opt_reset(&s);
+    prev_pc = inst->pc;
+
+    Op op = inst->op;
+    if (op == MOV || op == ADD || op == SUB || op == LOAD || op == STORE ||
+        op == PUTC || opt_is_cmp(op) || is_ext_op(op) ||
+        (opt_is_jump(op) && op != JMP)) {
+      opt_lookup(&s, &inst->src);
+    }
+    if (op == STORE || (opt_is_jump(op) && op != JMP)) {
+      inst->dst.reg = opt_root(&s, inst->dst.reg);
+    }
+    if (opt_is_jump(op)) {
+      opt_lookup(&s, &inst->jmp);
+    }
+
+    switch (op) {
+      case MOV: {
+        Reg d = inst->dst.reg;
+        OptReg* r = &s.regs[d];
+        if (inst->src.type == IMM) {
+          if (r->kind == OPT_CONST && r->v == inst->src.imm) {
+            opt_kill(inst);
+            break;
+          }
+          opt_clobber(&s, d);
+          r->kind = OPT_CONST;
+          r->v = inst->src.imm;
+        } else {
+          Reg src = inst->src.reg;
+          if (src == d || (r->kind == OPT_COPY && r->v == (int)src)) {
+            opt_kill(inst);
+            break;
+          }
+          opt_clobber(&s, d);
+          r->kind = OPT_COPY;
+          r->v = src;
+        }
+        break;
+      }
+
+      case ADD:
+      case SUB: {
+        Reg d = inst->dst.reg;
+        if (inst->src.type == IMM && inst->src.imm == 0) {
+          opt_kill(inst);
+          break;
+        }
+        OptReg* r = &s.regs[d];
+        if (r->kind == OPT_CONST && inst->src.type == IMM) {
+          int v = op == ADD ? r->v + inst->src.imm : r->v - inst->src.imm;
+          // Fold only when the result does not depend on the word size.
+          if (v >= 0 && v <= UINT_MAX) {
+            opt_clobber(&s, d);
+            opt_set_mov_imm(inst, v);
+            r->kind = OPT_CONST;
+            r->v = v;
+            break;
+          }
+        }
+        opt_clobber(&s, d);
+        break;
+      }
+
+      case LOAD: {
+        Reg d = inst->dst.reg;
+        if (s.mem.valid && opt_same_value(&s.mem.addr, &inst->src)) {
+          if (s.mem.reg == d) {
+            opt_kill(inst);
+            break;
+          }
+          Reg v = s.mem.reg;
+          inst->op = MOV;
+          inst->src.type = REG;
+          inst->src.reg = v;
+          opt_clobber(&s, d);
+          s.regs[d].kind = OPT_COPY;
+          s.regs[d].v = v;
+          break;
+        }
+        opt_clobber(&s, d);
+        if (inst->src.type != REG || inst->src.reg != d) {
+          s.mem.valid = true;
+          s.mem.addr = inst->src;
+          s.mem.reg = d;
+        }
+        break;
+      }
+
+      case STORE:
+        s.mem.valid = true;
+        s.mem.addr = inst->src;
+        s.mem.reg = inst->dst.reg;
+        break;
+
+      case GETC:
+        opt_clobber(&s, inst->dst.reg);
+        break;
+
+      case EQ:
+      case NE:
+      case LT:
+      case GT:
+      case LE:
+      case GE: {
+        Reg d = inst->dst.reg;
+        OptReg* r = &s.regs[d];
+        if (r->kind == OPT_CONST && inst->src.type == IMM) {
+          int v = opt_eval_cmp(op, r->v, inst->src.imm);
+          opt_clobber(&s, d);
+          opt_set_mov_imm(inst, v);
+          r->kind = OPT_CONST;
+          r->v = v;
+          break;
+        }
+        opt_clobber(&s, d);
+        break;
+      }
+
+      case MUL:
+      case DIV:
+      case MOD:
+      case AND:
+      case OR:
+      case XOR:
+      case SHL:
+      case SHR: {
+        Reg d = inst->dst.reg;
+        OptReg* r = &s.regs[d];
+        if (r->kind == OPT_CONST && inst->src.type == IMM) {
+          int v = eval_ext_op(op, r->v, inst->src.imm);
+          opt_clobber(&s, d);
+          opt_set_mov_imm(inst, v);
+          r->kind = OPT_CONST;
+          r->v = v;
+          break;
+        }
+        opt_clobber(&s, d);
+        break;
+      }
+
+      case JEQ:
+      case JNE:
+      case JLT:
+      case JGT:
+      case JLE:
+      case JGE: {
+        OptReg* r = &s.regs[inst->dst.reg];
+        if (r->kind == OPT_CONST && inst->src.type == IMM) {
+          if (opt_eval_cmp(op, r->v, inst->src.imm)) {
+            inst->op = JMP;
+          } else {
+            opt_kill(inst);
+          }
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+}
+
+static Inst** opt_pc_heads(Module* module, int* num_pcs) {
+  int max_pc = -1;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (max_pc < inst->pc)
+      max_pc = inst->pc;
+  }
+  *num_pcs = max_pc + 1;
+  Inst** heads = calloc(max_pc + 2, sizeof(Inst*));
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (!heads[inst->pc])
+      heads[inst->pc] = inst;
+  }
+  return heads;
+}
+
+// Retargets jumps to basic blocks which start with an unconditional
+// jump to an immediate.
+static void opt_thread_jumps(Module* module) {
+  int num_pcs;
+  Inst** heads = opt_pc_heads(module, &num_pcs);
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (!opt_is_jump(inst->op) || inst->jmp.type != IMM)
+      continue;
+    for (int i = 0; i < 16; i++) {
+      int t = inst->jmp.imm;
+      if (t < 0 || t >= num_pcs || !heads[t])
+        break;
+      Inst* h = heads[t];
+      if (h->op != JMP || h->jmp.type != IMM || h->jmp.imm == t ||
+          h->magic_comment)
+        break;
+      inst->jmp.imm = h->jmp.imm;
+    }
+  }
+  free(heads);
+}
+
+// Removes jumps to the basic block which follows anyway.
+static void opt_remove_branch_to_next(Module* module) {
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (opt_is_jump(inst->op) && inst->jmp.type == IMM && inst->next &&
+        inst->next->pc == inst->pc + 1 && inst->jmp.imm == inst->pc + 1) {
+      opt_kill(inst);
+    }
+  }
+}
+
+// Shrinks basic blocks which can be reached neither from the entry nor
+// through any value which may be a code address into a single EXIT.
+static void opt_remove_unreachable(CFG* cfg) {
+  for (int pc = 0; pc < cfg->num_blocks; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    if (!bb->head || bb->reachable)
+      continue;
+    Inst* inst = bb->head;
+    inst->op = EXIT;
+    inst->magic_comment = NULL;
+    for (int i = 1; i < bb->num_insts; i++) {
+      inst = inst->next;
+      inst->op = (Op)OPT_DEAD;
+      inst->magic_comment = NULL;
+    }
+  }
+}
+
+// Removes instructions whose only effect is to write a register which
+// is never read afterwards.
+static void opt_remove_dead_defs(CFG* cfg) {
+  int cap = 0;
+  RegSet* live = NULL;
+  for (int pc = 0; pc < cfg->num_blocks; pc++) {
+    BasicBlock* bb = &cfg->blocks[pc];
+    if (!bb->head)
+      continue;
+    if (cap < bb->num_insts) {
+      free(live);
+      cap = bb->num_insts * 2;
+      live = malloc(sizeof(RegSet) * cap);
+    }
+    cfg_inst_live_out(bb, live);
+    Inst* inst = bb->head;
+    for (int i = 0; i < bb->num_insts; i++, inst = inst->next) {
+      if (inst->op == GETC)
+        continue;
+      RegSet defs = inst_defs(inst);
+      if (defs && !(defs & live[i]))
+        opt_kill(inst);
+    }
+  }
+  free(live);
+}
+
+// Unlinks dead instructions. A basic block which would become empty
+// keeps one of them as DUMP.
+static void opt_sweep(Module* module) {
+  Inst root = {};
+  root.next = module->text;
+  Inst* prev = &root;
+  bool pc_has_inst = false;
+  for (Inst* inst = module->text; inst; inst = inst->next) {
+    if (prev == &root || prev->pc != inst->pc)
+      pc_has_inst = false;
+    if (inst->op == (Op)OPT_DEAD) {
+      bool last_in_pc = !inst->next || inst->next->pc != inst->pc;
+      if (pc_has_inst || !last_in_pc) {
+        prev->next = inst->next;
+        continue;
+      }
+      inst->op = DUMP;
+    }
+    pc_has_inst = true;
+    prev = inst;
+  }
+  module->text = root.next;
+}
+
+void optimize_module(Module* module, int level) {
+  if (level <= 0 || !module->text)
+    return;
+  opt_propagate(module);
+  if (level >= 2) {
+    opt_thread_jumps(module);
+    opt_remove_branch_to_next(module);
+    CFG* cfg = build_cfg(module);
+    opt_remove_unreachable(cfg);
+    opt_remove_dead_defs(cfg);
+    free_cfg(cfg);
+  }
+  opt_sweep(module);
+}
@@ -3,20 +3,94 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define TABLE_INITIAL_CAP 256
+#define TABLE_ARENA_CHUNK 65536
+
+static unsigned int table_hash(const char* key) {
+  unsigned int h = 5381;
+  for (; *key; key++) {
+    h = h * 33 + (unsigned char)*key;
+  }
+  return h;
+}
+
+static const char* table_intern(Table* tbl, const char* key) {
+  int len = strlen(key) + 1;
+  if (len > TABLE_ARENA_CHUNK / 4) {
+    return strdup(key);
+  }
+  if (tbl->arena_left < len) {
+    tbl->arena = malloc(TABLE_ARENA_CHUNK);
+    tbl->arena_left = TABLE_ARENA_CHUNK;
+  }
+  char* r = tbl->arena;
+  memcpy(r, key, len);
+  tbl->arena += len;
+  tbl->arena_left -= len;
+  return r;
+}
+
+static int table_find(Table* tbl, const char* key, unsigned int h) {
+  int mask = tbl->cap - 1;
+  for (int i = h & mask;; i = (i + 1) & mask) {
+    if (!tbl->keys[i])
+      return i;
+    if (tbl->hashes[i] == h && !strcmp(tbl->keys[i], key))
+      return i;
+  }
+}
+
+static void table_alloc(Table* tbl, int cap) {
+  tbl->cap = cap;
+  tbl->keys = calloc(cap, sizeof(char*));
+  tbl->values = calloc(cap, sizeof(void*));
+  tbl->hashes = calloc(cap, sizeof(unsigned int));
+}
+
+static void table_grow(Table* tbl) {
+  const char** keys = tbl->keys;
+  const void** values = tbl->values;
+  unsigned int* hashes = tbl->hashes;
+  int cap = tbl->cap;
+  table_alloc(tbl, cap * 2);
+  for (int i = 0; i < cap; i++) {
+    if (!keys[i])
+      continue;
+    int j = table_find(tbl, keys[i], hashes[i]);
+    tbl->keys[j] = keys[i];
+    tbl->values[j] = values[i];
+    tbl->hashes[j] = hashes[i];
+  }
+  free(keys);
+  free(values);
+  free(hashes);
+}
+
 Table* table_add(Table* tbl, const char* key, const void* value) {
-  Table* ntbl = malloc(sizeof(Table));
-  ntbl->next = tbl;
-  ntbl->key = key;
-  ntbl->value = value;
-  return ntbl;
+  if (!tbl) {
+    tbl = calloc(1, sizeof(Table));
+    table_alloc(tbl, TABLE_INITIAL_CAP);
+  }
+  if ((tbl->size + 1) * 2 > tbl->cap) {
+    table_grow(tbl);
+  }
+  unsigned int h = table_hash(key);
+  int i = table_find(tbl, key, h);
+  if (!tbl->keys[i]) {
+    tbl->keys[i] = table_intern(tbl, key);
+    tbl->hashes[i] = h;
+    tbl->size++;
+  }
+  tbl->values[i] = value;
+  return tbl;
 }
 
 bool table_get(Table* tbl, const char* key, const void** value) {
-  for (; tbl; tbl = tbl->next) {
-    if (!strcmp(tbl->key, key)) {
-      *value = tbl->value;
-      return true;
-    }
-  }
-  return false;
+  if (!tbl)
+    return false;
+  int i = table_find(tbl, key, table_hash(key));
+  if (!tbl->keys[i])
+    return false;
+  *value = tbl->values[i];
+  return true;
 }
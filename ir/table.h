@@ -3,12 +3,22 @@
 
 #include <stdbool.h>
 
+// An open-addressing hash table keyed by strings. Keys are interned
+// into an arena owned by the table, so callers may pass temporary
+// buffers. Adding an existing key overwrites its value.
 typedef struct Table_ {
-  const char* key;
-  const void* value;
-  struct Table_* next;
+  const char** keys;
+  const void** values;
+  unsigned int* hashes;
+  int cap;
+  int size;
+  char* arena;
+  int arena_left;
 } Table;
 
+// Adds |key| to |tbl|. |tbl| can be NULL, in which case a new table is
+// created. The passed table is modified in place, so previous handles
+// alias the returned one.
 Table* table_add(Table* tbl, const char* key, const void* value);
 
 bool table_get(Table* tbl, const char* key, const void** value);
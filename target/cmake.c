@@ -438,6 +438,14 @@ static char const* cmake_op_str(Op op) {
   switch (op) {
   case OP_UNSET:
   case OP_ERR:
+  case MUL:
+  case DIV:
+  case MOD:
+  case AND:
+  case OR:
+  case XOR:
+  case SHL:
+  case SHR:
   case LAST_OP: {
     error(format("Invalid opcode %d", op));
   } break;
@@ -152,6 +152,17 @@ static target_func_t get_target_func(const char* ext) {
 
 bool handle_mcfunction_args(const char* arg, const char* value);
 
+// Targets which emit extension operations natively. Others get them
+// expanded by lower_ext_ops.
+static bool target_has_ext_ops(const char* ext) {
+  static const char* exts[] = { "c", "js", "py", "rb", NULL };
+  for (int i = 0; exts[i]; i++) {
+    if (!strcmp(ext, exts[i]))
+      return true;
+  }
+  return false;
+}
+
 typedef bool (*handle_args_func_t)(const char*, const char*);
 
 static handle_args_func_t get_handle_args_func(const char* ext) {
@@ -173,14 +184,22 @@ int main(int argc, char* argv[]) {
   }
   target_func_t target_func = get_target_func(buf);
   Module* module = load_eir(stdin);
+  if (!target_has_ext_ops(buf))
+    lower_ext_ops(module);
 #else
   target_func_t target_func = NULL;
   const char* ext = NULL;
   const char* filename = NULL;
+  int opt_level = 0;
+  bool use_ext_ops = true;
   for (int i = 1; i < argc; i++) {
     const char* arg = argv[i];
     if (arg[0] == '-') {
-      if (target_func) {
+      if (arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '9' && !arg[3]) {
+        opt_level = arg[2] - '0';
+      } else if (!strcmp(arg, "-no-ext-ops")) {
+        use_ext_ops = false;
+      } else if (target_func) {
         handle_args_func_t handle_args = get_handle_args_func(ext);
         if (!handle_args || !handle_args(arg + 1, argv[++i])) {
           error("unknown flag");
@@ -202,6 +221,9 @@ int main(int argc, char* argv[]) {
   }
 
   Module* module = load_eir_from_file(filename);
+  optimize_module(module, opt_level);
+  if (!use_ext_ops || !target_has_ext_ops(ext))
+    lower_ext_ops(module);
 #endif
   target_func(module);
 }
@@ -97,6 +97,46 @@ static void js_emit_inst(Inst* inst) {
               reg_names[inst->dst.reg], cmp_str(inst, "true"));
     break;
 
+  case MUL:
+    emit_line("%s = (%s * %s) & " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case DIV:
+    emit_line("%s = %s ? Math.floor(%s / %s) : " UINT_MAX_STR ";",
+              reg_names[inst->dst.reg], src_str(inst),
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case MOD:
+    emit_line("%s = %s ? %s %% %s : %s;",
+              reg_names[inst->dst.reg], src_str(inst),
+              reg_names[inst->dst.reg], src_str(inst),
+              reg_names[inst->dst.reg]);
+    break;
+
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%s %s= %s;",
+              reg_names[inst->dst.reg],
+              inst->op == AND ? "&" : inst->op == OR ? "|" : "^",
+              src_str(inst));
+    break;
+
+  case SHL:
+    emit_line("%s = %s < 24 ? (%s << %s) & " UINT_MAX_STR " : 0;",
+              reg_names[inst->dst.reg], src_str(inst),
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case SHR:
+    emit_line("%s = %s < 24 ? %s >> %s : 0;",
+              reg_names[inst->dst.reg], src_str(inst),
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
   case JEQ:
   case JNE:
   case JLT:
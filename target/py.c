@@ -98,6 +98,46 @@ static void py_emit_inst(Inst* inst) {
               reg_names[inst->dst.reg], cmp_str(inst, "True"));
     break;
 
+  case MUL:
+    emit_line("%s = (%s * %s) & " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst));
+    break;
+
+  case DIV:
+    emit_line("%s = %s // %s if %s else " UINT_MAX_STR,
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst), src_str(inst));
+    break;
+
+  case MOD:
+    emit_line("%s = %s %% %s if %s else %s",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst), src_str(inst),
+              reg_names[inst->dst.reg]);
+    break;
+
+  case AND:
+  case OR:
+  case XOR:
+    emit_line("%s %s= %s",
+              reg_names[inst->dst.reg],
+              inst->op == AND ? "&" : inst->op == OR ? "|" : "^",
+              src_str(inst));
+    break;
+
+  case SHL:
+    emit_line("%s = (%s << %s) & " UINT_MAX_STR " if %s < 24 else 0",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst), src_str(inst));
+    break;
+
+  case SHR:
+    emit_line("%s = %s >> %s if %s < 24 else 0",
+              reg_names[inst->dst.reg],
+              reg_names[inst->dst.reg], src_str(inst), src_str(inst));
+    break;
+
   case JEQ:
   case JNE:
   case JLT:
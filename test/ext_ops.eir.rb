@@ -0,0 +1,78 @@
+def emit_print(m)
+  m.each_byte{|b|
+    puts "mov A, #{b}"
+    puts "putc A"
+  }
+end
+
+M = 16777215
+
+def ext_op(op, x, y)
+  case op
+  when 'mul' then (x * y) & M
+  when 'div' then y == 0 ? M : x / y
+  when 'mod' then y == 0 ? x : x % y
+  when 'and' then x & y
+  when 'or' then x | y
+  when 'xor' then x ^ y
+  when 'shl' then y < 24 ? (x << y) & M : 0
+  when 'shr' then y < 24 ? x >> y : 0
+  end
+end
+
+ARGS = [[0, 0], [7, 9], [1000, 1000], [12345, 0], [M, M], [M, 2],
+        [8388608, 3], [8388609, 8388607], [4660, 23], [5592405, 24],
+        [11184810, 1], [99, 100]]
+
+$label = 0
+
+def emit_check(reg, expected)
+  $label += 1
+  puts "jeq ok#{$label}, #{reg}, #{expected}"
+  puts "putc 120"
+  puts "jmp done#{$label}"
+  puts "ok#{$label}:"
+  puts "putc 111"
+  puts "done#{$label}:"
+end
+
+%w(mul div mod and or xor shl shr).each do |op|
+  emit_print(op + ": ")
+  ARGS.each do |x, y|
+    # Immediate source.
+    puts "mov C, #{x}"
+    puts "#{op} C, #{y}"
+    emit_check('C', ext_op(op, x, y))
+    # Register source, and other registers must be kept.
+    puts "mov BP, #{x}"
+    puts "mov D, #{y}"
+    puts "mov B, 42"
+    puts "#{op} BP, D"
+    puts "mov A, BP"
+    emit_check('A', ext_op(op, x, y))
+    emit_check('D', y)
+    emit_check('B', 42)
+  end
+  emit_print "\n"
+end
+
+# SP as an operand, and two extension operations in a basic block.
+puts "mov A, SP"
+puts "mov SP, 1234"
+puts "mul SP, 3"
+puts "mov B, SP"
+puts "mov SP, A"
+puts "mov C, 10"
+puts "shl C, 2"
+puts "or C, 1"
+emit_check('B', 3702)
+emit_check('C', 41)
+emit_print "\n"
+
+# An extension operation in the last basic block which falls through.
+puts "mov A, 6"
+puts "mul A, 11"
+puts "putc A"
+puts "mov A, 10"
+puts "putc A"
+puts "exit"
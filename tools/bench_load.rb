@@ -0,0 +1,54 @@
+#!/usr/bin/env ruby
+#
+# Measures how the time to load EIR scales with the number of labels.
+#
+# Usage: tools/bench_load.rb [loader] [eir files...]
+#
+# Synthetic modules with N functions are generated in out/ and loaded
+# with the loader ("out/dump_ir -q" by default, which loads the module
+# and exits without dumping it). Each function calls the
+# next one through a label, so every operand needs a symbol lookup.
+# Extra EIR files (e.g., out/8cc.c.eir) are measured as well.
+
+loader = ARGV.shift || 'out/dump_ir -q'
+files = ARGV
+
+def gen_eir(n)
+  s = ''
+  n.times do |i|
+    s << "func#{i}:\n"
+    s << " mov A, func#{(i + 1) % n}\n"
+    s << " mov B, data#{i}\n"
+    s << " load C, B\n"
+    s << " jeq func#{(i * 7 + 3) % n}, A, C\n"
+  end
+  s << "main:\n"
+  s << " exit\n"
+  s << " .data\n"
+  n.times do |i|
+    s << "data#{i}:\n"
+    s << " .long func#{i}\n"
+  end
+  s
+end
+
+def measure(loader, file)
+  t = Time.now
+  system("#{loader} #{file} > /dev/null 2>&1") or raise "#{loader} #{file} failed"
+  Time.now - t
+end
+
+puts "%-24s %10s %10s %12s" % %w(file labels sec usec/label)
+[5000, 10000, 20000, 40000, 80000].each do |n|
+  file = "out/bm_load_#{n}.eir"
+  File.write(file, gen_eir(n))
+  sec = measure(loader, file)
+  labels = n * 2
+  puts "%-24s %10d %10.3f %12.3f" % [file, labels, sec, sec * 1e6 / labels]
+end
+
+files.each do |file|
+  labels = File.read(file).scan(/^[\w.]+:/).size
+  sec = measure(loader, file)
+  puts "%-24s %10d %10.3f %12.3f" % [file, labels, sec, sec * 1e6 / labels]
+end